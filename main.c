@@ -9,30 +9,80 @@
  *      blocks to make searching for previous blocks O(1) instead of O(n)
  *  -   Added block splitting when a free block is recycled that's too large,
  *      and block merging upon freeing.
+ *  -   Added a handle-based allocation API (myhandle_*). Blocks owned by an
+ *      unlocked handle may be moved by mycompact(), which slides them towards
+ *      HEAD, rebuilds the list and gives the freed tail back to the OS.
+ *  -   Added purging of free blocks: once a block has been free for
+ *      PURGE_DECAY_SECONDS, the whole pages inside it are given back to the
+ *      OS with madvise(), and the block is marked as purged.
+ *  -   Blocks of at least MMAP_THRESHOLD bytes get their own mapping instead
+ *      of living on the list, so that realloc() can grow and shrink them
+ *      with mremap() instead of copying.
+ *  -   Added tagged allocations (mymalloc_tagged()). Live bytes and blocks
+ *      are counted per tag, and can be read with mytag_snapshot().
  * 
  * Planned changes to the program logic:
  *  -   TBD: Add best-fit as alternative to current first-fit.
  * 
 */ 
 
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
 
 #define ALLOC_BEST_FIT 1
 
-// For every allocated block, we store some metadata
+// Seconds a block has to be free before its pages are purged
+#define PURGE_DECAY_SECONDS 10
+
+// Blocks of at least this size get their own mapping
+#define MMAP_THRESHOLD (128 * 1024)
+
+// Number of different tags (a tag is stored in one byte of the metadata)
+#define MAX_TAGS 256
+
+// For every allocated block, we store some metadata.
+// The small fields after free share the padding in front of next,
+// so that they don't make the metadata any larger.
 struct metadata {
   size_t size;
   int free;
+  unsigned char purged : 1;
+  unsigned char mapped : 1;
+  unsigned char tag;
+  // Index of the owning handle in HANDLES plus one, 0 if there is none
+  unsigned short handle;
   struct metadata* next;
   struct metadata* prev;
 };
 
 
+// A handle owns one block, which may be moved around by mycompact()
+// as long as the handle is not locked.
+struct handle {
+  struct metadata* block;
+  int locks;
+};
+
+// Maximum number of handles that may be in use at the same time
+#define MAX_HANDLES 1024
+
+
+// Live memory of one tag, as returned by mytag_snapshot()
+struct tag_stats {
+  size_t live_bytes;
+  size_t live_blocks;
+};
+
+
 // The amount of bytes we need for one block's metadata
 #define META_SIZE sizeof(struct metadata)
 
@@ -41,6 +91,71 @@ struct metadata {
 struct metadata* HEAD = NULL;
 struct metadata* TAIL = NULL;
 
+// List of blocks with their own mapping, so that myfree() can tell
+// whether such a block is still mapped before touching its metadata
+struct metadata* MAPPED = NULL;
+
+// Table of handles. A slot is unused if its block is NULL.
+struct handle HANDLES[MAX_HANDLES];
+
+
+// Convenience function to get the handle that owns a block (or NULL)
+struct handle* get_handle(struct metadata* block) {
+  return block->handle ? &HANDLES[block->handle - 1] : NULL;
+}
+
+// Time of the last purge run
+time_t LAST_PURGE = 0;
+
+
+
+// Current time in seconds from a coarse clock, which is cheap enough
+// to be read on every allocator call
+time_t coarse_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
+
+
+// The time a block was freed is only needed while the block is free,
+// so it is stored at the start of the block's (unused) memory instead
+// of in the metadata. Blocks too small to hold it count as freed at 0;
+// they don't contain any whole page that could be purged anyway.
+void set_freed_at(struct metadata* block, time_t freed_at) {
+    if (block->size >= sizeof(time_t)) {
+        memcpy(block+1, &freed_at, sizeof(time_t));
+    }
+}
+
+time_t get_freed_at(struct metadata* block) {
+    time_t freed_at = 0;
+    if (block->size >= sizeof(time_t)) {
+        memcpy(&freed_at, block+1, sizeof(time_t));
+    }
+    return freed_at;
+}
+
+// Live bytes and blocks per tag. These are atomic, so that another thread
+// may take a snapshot while allocations are going on.
+_Atomic size_t TAG_BYTES[MAX_TAGS];
+_Atomic size_t TAG_BLOCKS[MAX_TAGS];
+
+
+// Count a block as allocated for the given tag
+void tag_alloc(struct metadata* block, unsigned char tag) {
+    block->tag = tag;
+    atomic_fetch_add_explicit(&TAG_BYTES[tag], block->size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&TAG_BLOCKS[tag], 1, memory_order_relaxed);
+}
+
+
+// Remove an allocated block from the counts of its tag
+void tag_free(struct metadata* block) {
+    atomic_fetch_sub_explicit(&TAG_BYTES[block->tag], block->size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&TAG_BLOCKS[block->tag], 1, memory_order_relaxed);
+}
+
 // Trying to find a free block of suitable size in the list.
 // Return the first that fits.
 struct metadata* find_first_free_block(size_t size) {
@@ -103,17 +218,116 @@ struct metadata* request_space(size_t size) {
     block->size = size;
     block->next = NULL;
     block->free = 0;
+    block->purged = 0;
+    block->mapped = 0;
     return block;
 }
 
 
-void *mymalloc(size_t size) {
+// Length of the mapping for a block of the given size,
+// which is rounded up to whole pages.
+// Returns 0 if the size is too large to be rounded up without overflow.
+size_t mapping_length(size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - META_SIZE - page) { return 0; }
+    return (META_SIZE + size + page - 1) & ~(page - 1);
+}
+
+
+// Request a block of memory with its own mapping from the OS.
+// Such a block is not put on the global list.
+struct metadata* request_mapping(size_t size) {
+    size_t length = mapping_length(size);
+    if (!length) { return NULL; }
+
+    struct metadata* block = mmap(NULL, length,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) { return NULL; }
+
+    // Write entry, put it in front of the list of mapped blocks,
+    // and return it
+    block->size = size;
+    block->next = MAPPED;
+    block->prev = NULL;
+    block->free = 0;
+    block->purged = 0;
+    block->mapped = 1;
+    if (MAPPED) {
+        MAPPED->prev = block;
+    }
+    MAPPED = block;
+    return block;
+}
+
+
+// Convenience functions to round an address up / down to a page boundary
+char* page_align_up(char* addr) {
+  uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  return (char*) (((uintptr_t) addr + page - 1) & ~(page - 1));
+}
+
+char* page_align_down(char* addr) {
+  uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  return (char*) ((uintptr_t) addr & ~(page - 1));
+}
+
+
+// Give the whole pages inside all blocks that have been free for at least
+// PURGE_DECAY_SECONDS back to the OS. The blocks stay on the list; their
+// pages are just unmapped and will be mapped in again (zeroed) on next use.
+// MADV_DONTNEED is used instead of MADV_FREE, as only the former guarantees
+// that the pages read back as zeros.
+void mypurge() {
+  time_t now = coarse_now();
+  LAST_PURGE = now;
+
+  struct metadata* current = HEAD;
+  while (current) {
+      if (current->free && !current->purged
+          && now - get_freed_at(current) >= PURGE_DECAY_SECONDS) {
+          // Only whole pages can be purged; the metadata and the partial
+          // pages at both ends of the block are kept
+          char* start = page_align_up((char*) (current+1));
+          char* end = page_align_down((char*) (current+1) + current->size);
+
+          if (end <= start || !madvise(start, (size_t) (end - start), MADV_DONTNEED)) {
+              current->purged = 1;
+          }
+      }
+      current = current->next;
+  }
+}
+
+
+// Run mypurge() if the last run is at least PURGE_DECAY_SECONDS ago
+void purge_if_due(time_t now) {
+  if (now - LAST_PURGE >= PURGE_DECAY_SECONDS) {
+      mypurge();
+  }
+}
+
+
+// Allocate a block of memory and count it for the given tag
+void *mymalloc_tagged(size_t size, unsigned char tag) {
     // Evidently nonsense
     if (size <= 0) { return NULL; }
 
+    // Purge blocks that have been free for long enough
+    purge_if_due(coarse_now());
+
     // New block to be stored in here
     struct metadata *block;
 
+    // Large blocks get their own mapping and bypass the list
+    if (size >= MMAP_THRESHOLD) {
+        block = request_mapping(size);
+        if (!block) { return NULL; }
+        block->handle = 0;
+        tag_alloc(block, tag);
+        return (block+1);
+    }
+
     // First call -- our global list is still empty,
     if (!HEAD) {
         // and thus we need to request space from the OS.
@@ -155,11 +369,24 @@ void *mymalloc(size_t size) {
                     TAIL = surplus;
                 }
                 
-                // Write metadata for the surplus block
-                surplus->size = block->size - size - 2*META_SIZE;
+                // Write metadata for the surplus block, which gets all the
+                // memory behind the allocated block except its own metadata,
+                // so that no memory gets lost between the two blocks
+                surplus->size = block->size - size - META_SIZE;
                 surplus->next = block->next;
                 surplus->prev = block;
                 surplus->free = 1;
+                surplus->mapped = 0;
+                surplus->handle = 0;
+
+                // The surplus' metadata lies in front of its data, so the
+                // whole pages inside its data are still purged (if they were).
+                // Only a block that is not purged needs the time it was freed,
+                // and writing it into a purged page would make it non-zero.
+                surplus->purged = block->purged;
+                if (!block->purged) {
+                    set_freed_at(surplus, get_freed_at(block));
+                }
 
                 // If the successor of the surplus block is not NULL,
                 // we set its *prev to surplus
@@ -183,6 +410,10 @@ void *mymalloc(size_t size) {
         }
     }
         
+    // Blocks returned by mymalloc() are not owned by a handle
+    block->handle = 0;
+    tag_alloc(block, tag);
+
     // Return pointer to the actual block of free memory
     // (right after the metadata)
     return (block+1);
@@ -190,6 +421,12 @@ void *mymalloc(size_t size) {
 
 
 
+// Allocate a block of memory without a specific tag (tag 0)
+void *mymalloc(size_t size) {
+    return mymalloc_tagged(size, 0);
+}
+
+
 // Convenience function to plot the complete global linked list
 void print_list() {
     printf("------------------------------------------------------------------------\n");
@@ -220,23 +457,81 @@ struct metadata *get_block_ptr(void *ptr) {
 }
 
 
+// Whether block second directly follows block first in memory
+int is_adjacent(struct metadata* first, struct metadata* second) {
+  return (char*) first + META_SIZE + first->size == (char*) second;
+}
+
+
+// Whether ptr lies within the heap of the global list
+int on_heap(void *ptr) {
+  return HEAD && (char*) ptr > (char*) HEAD
+         && (char*) ptr <= (char*) TAIL + META_SIZE + TAIL->size;
+}
+
+
+// Find the mapped block whose memory ptr points to.
+// Returns NULL if there is none (anymore).
+struct metadata* find_mapping(void *ptr) {
+  struct metadata* current = MAPPED;
+  while (current && (void*) (current+1) != ptr) {
+      current = current->next;
+  }
+  return current;
+}
+
+
 void myfree(void *ptr) {
+  struct metadata* prev_block;
+  struct metadata* next_block;
+
   // Calling free(NULL) is supported
   if (!ptr) { return; }
  
+  // Blocks outside of the heap have their own mapping, and are simply
+  // unmapped. Their metadata is only touched if they are still mapped,
+  // so that freeing them twice is supported, too.
+  if (!on_heap(ptr)) {
+      struct metadata* mapped = find_mapping(ptr);
+      if (!mapped) { return; }
+
+      // Remove it from the list of mapped blocks
+      if (mapped->prev) {
+          mapped->prev->next = mapped->next;
+      } else {
+          MAPPED = mapped->next;
+      }
+      if (mapped->next) {
+          mapped->next->prev = mapped->prev;
+      }
+
+      tag_free(mapped);
+      munmap(mapped, mapping_length(mapped->size));
+      return;
+  }
+
   // Get pointer to metadata of the block of memory that shall be freed
   struct metadata* block = get_block_ptr(ptr);
-  
+
   // Freeing a freed block is supported
   if (block->free) { return; }
+
+  tag_free(block);
   
+  time_t now = coarse_now();
+
   // Free it
   block->free = 1;
+  block->handle = 0;
+  block->purged = 0;
+  set_freed_at(block, now);
   
-  // If the block "to the right" exists and is free, we merge them
+  // If the block "to the right" exists, is free and directly follows the
+  // current one (someone else may have moved the program break in between),
+  // we merge them
   prev_block = block->prev;
   next_block = block->next;
-  if (next_block && next_block->free) {
+  if (next_block && next_block->free && is_adjacent(block, next_block)) {
       // Increase size of current block
       block->size = block->size + META_SIZE + next_block->size;
 
@@ -258,14 +553,18 @@ void myfree(void *ptr) {
       } 
   }
     
-  // Same for the block "to the left" if it exists and is free
+  // Same for the block "to the left" if it exists, is free and adjacent
   prev_block = block->prev;
   next_block = block->next;
-  if (prev_block && prev_block->free) {
+  if (prev_block && prev_block->free && is_adjacent(prev_block, block)) {
     // Size of previous block is set to its size + size of one meta block
     // + size of the current block
     prev_block->size = prev_block->size + META_SIZE + block->size;
 
+    // Merged block contains memory that is neither purged nor old
+    prev_block->purged = 0;
+    set_freed_at(prev_block, now);
+
     // Successor of previous block is set to current block's successor
     // (which might very well be NULL)
     prev_block->next = next_block;
@@ -283,6 +582,9 @@ void myfree(void *ptr) {
         TAIL = prev_block;
     }
   } 
+
+  // Purge blocks that have been free for long enough
+  purge_if_due(now);
 }
 
 
@@ -292,9 +594,26 @@ void* mycalloc(size_t nelem, size_t elsize) {
       return NULL;
   }
   
-  // Allocate block, initialise with zeros and return.
+  // Allocate block
   size_t size = nelem * elsize;
   void *ptr = mymalloc(size); 
+  if (!ptr) { return NULL; }
+
+  // A block with its own mapping is fresh from the OS and thus zero already
+  struct metadata* block = get_block_ptr(ptr);
+  if (block->mapped) { return ptr; }
+
+  // If the block has been purged, its whole pages are zero already,
+  // and only the partial pages at both ends need to be initialised
+  char* start = page_align_up((char*) ptr);
+  char* end = page_align_down((char*) ptr + size);
+  if (block->purged && start < end) {
+      memset(ptr, 0, (size_t) (start - (char*) ptr));
+      memset(end, 0, (size_t) ((char*) ptr + size - end));
+      return ptr;
+  }
+
+  // Otherwise, initialise with zeros and return.
   memset(ptr, 0, size);
   return ptr;
 }
@@ -307,17 +626,58 @@ void *myrealloc(void *ptr, size_t size) {
   // Get metadata associated with the block of memory ptr points to
   struct metadata* block_ptr = get_block_ptr(ptr);
   
+  // Blocks with their own mapping are grown and shrunk by remapping
+  // their pages, which avoids copying the data
+  if (block_ptr->mapped) {
+      size_t old_size = block_ptr->size;
+      size_t length = mapping_length(size);
+      if (!length) { return NULL; }
+
+      struct metadata* new_block = mremap(block_ptr,
+                                          mapping_length(old_size),
+                                          length,
+                                          MREMAP_MAYMOVE);
+      if (new_block == MAP_FAILED) { return NULL; }
+      new_block->size = size;
+
+      // Update the counts of the block's tag to the new size
+      atomic_fetch_sub_explicit(&TAG_BYTES[new_block->tag], old_size, memory_order_relaxed);
+      atomic_fetch_add_explicit(&TAG_BYTES[new_block->tag], size, memory_order_relaxed);
+
+      // Neighbours on the list of mapped blocks, and a handle,
+      // have to follow the block if it was moved
+      if (new_block->prev) {
+          new_block->prev->next = new_block;
+      } else {
+          MAPPED = new_block;
+      }
+      if (new_block->next) {
+          new_block->next->prev = new_block;
+      }
+      if (new_block->handle) {
+          get_handle(new_block)->block = new_block;
+      }
+      return (new_block+1);
+  }
+
   // If we already have enough space, we don't do anything
   // TODO: Split block?
   if (block_ptr->size >= size) { return ptr; }
 
   // Need to really realloc.
-  // Malloc new space first. Return NULL if failure
-  void *new_ptr = mymalloc(size);
+  // Malloc new space first, with the same tag. Return NULL if failure
+  void *new_ptr = mymalloc_tagged(size, block_ptr->tag);
   if (!new_ptr) { return NULL; }
 
   // Copy data to new memory
   memcpy(new_ptr, ptr, block_ptr->size);
+
+  // A handle is handed over to the new block
+  if (block_ptr->handle) {
+      struct metadata* new_block = get_block_ptr(new_ptr);
+      new_block->handle = block_ptr->handle;
+      get_handle(new_block)->block = new_block;
+  }
   
   // Free old block of memory
   myfree(ptr);
@@ -326,6 +686,204 @@ void *myrealloc(void *ptr, size_t size) {
   return new_ptr;
 }
 
+// Allocate a block of memory that is owned by a handle.
+// Returns NULL if no handle is left or the allocation fails.
+struct handle* myhandle_alloc(size_t size) {
+  // Find an unused slot in the handle table
+  struct handle* h = NULL;
+  for (int i = 0; i < MAX_HANDLES; i++) {
+      if (!HANDLES[i].block) {
+          h = &HANDLES[i];
+          break;
+      }
+  }
+  if (!h) { return NULL; }
+
+  void* ptr = mymalloc(size);
+  if (!ptr) { return NULL; }
+
+  // Link block and handle in both directions, so that
+  // mycompact() can update the handle when moving the block
+  h->block = get_block_ptr(ptr);
+  h->locks = 0;
+  h->block->handle = (unsigned short) (h - HANDLES + 1);
+  return h;
+}
+
+
+// Pin the block of a handle and return a pointer to its memory.
+// The pointer stays valid until the matching myhandle_unlock().
+void* myhandle_lock(struct handle* h) {
+  if (!h || !h->block) { return NULL; }
+  h->locks++;
+  return (h->block+1);
+}
+
+
+// Release one lock of a handle; the block may be moved again once
+// all locks have been released.
+void myhandle_unlock(struct handle* h) {
+  if (!h || !h->block || !h->locks) { return; }
+  h->locks--;
+}
+
+
+// Free the block of a handle and release the handle itself
+void myhandle_free(struct handle* h) {
+  if (!h || !h->block) { return; }
+  myfree(h->block+1);
+  h->block = NULL;
+  h->locks = 0;
+}
+
+
+// Write a free block covering the memory from start to end, and append it
+// to the list behind last. Returns the new block.
+struct metadata* append_free_block(struct metadata* last, char* start, char* end) {
+  struct metadata* block = (struct metadata*) start;
+  block->size = (size_t) (end - start) - META_SIZE;
+  block->free = 1;
+  block->handle = 0;
+  block->purged = 0;
+  block->mapped = 0;
+  set_freed_at(block, coarse_now());
+  block->prev = last;
+  block->next = NULL;
+  if (last) {
+      last->next = block;
+  } else {
+      HEAD = block;
+  }
+  return block;
+}
+
+
+// Slide all blocks owned by unlocked handles towards HEAD, so that
+// the free memory between them ends up at the end of the heap,
+// where it is given back to the OS.
+// Blocks from mymalloc() and locked blocks stay where they are;
+// the free memory in front of them remains as a free block.
+// If someone else has moved the program break between two of our
+// request_space() calls, the heap consists of several contiguous runs
+// of blocks. Blocks are never moved from one run into another, and the
+// memory between runs (which isn't ours) never becomes part of a block.
+// (Free blocks always have metadata, so any gap that is left
+// between kept blocks is large enough to hold a free block.)
+void mycompact() {
+  if (!HEAD) { return; }
+
+  // End of the heap, before compaction
+  char* heap_end = (char*) TAIL + META_SIZE + TAIL->size;
+
+  // Address where the next block that is kept will be placed
+  char* cursor = (char*) HEAD;
+
+  // Last block of the rebuilt list
+  struct metadata* last = NULL;
+
+  // End of the previous block, before compaction
+  char* run_end = NULL;
+
+  struct metadata* current = HEAD;
+  while (current) {
+      // Remember successor and end now, as the block may be
+      // overwritten below
+      struct metadata* next = current->next;
+      char* current_end = (char*) current + META_SIZE + current->size;
+      struct metadata* block = NULL;
+
+      // The current block doesn't directly follow the previous one, thus
+      // a new run starts: the free memory left at the end of the previous
+      // run becomes a free block, and the cursor jumps to the new run.
+      if (run_end && (char*) current != run_end) {
+          if (cursor != run_end) {
+              last = append_free_block(last, cursor, run_end);
+          }
+          cursor = (char*) current;
+      }
+      run_end = current_end;
+
+      if (current->free) {
+          // Free blocks are dropped, their memory is reused by
+          // the blocks that are moved down
+      } else if (current->handle && !get_handle(current)->locks) {
+          // Movable block: slide it down to the cursor
+          block = (struct metadata*) cursor;
+          if (block != current) {
+              memmove(block, current, META_SIZE + current->size);
+              get_handle(block)->block = block;
+          }
+      } else {
+          // Pinned block: if there is a gap in front of it,
+          // the gap becomes a free block.
+          if ((char*) current != cursor) {
+              last = append_free_block(last, cursor, (char*) current);
+          }
+          block = current;
+      }
+
+      // Append the kept block to the rebuilt list
+      if (block) {
+          block->prev = last;
+          block->next = NULL;
+          if (last) {
+              last->next = block;
+          } else {
+              HEAD = block;
+          }
+          last = block;
+          cursor = (char*) block + META_SIZE + block->size;
+      }
+
+      current = next;
+  }
+
+  // Memory behind the last kept block is free now. It is given back to
+  // the OS, unless someone else (e.g. libc's malloc) has moved the program
+  // break since -- then it is kept as a free block at the end of the list.
+  if (cursor != heap_end) {
+      if (sbrk(0) == heap_end) {
+          sbrk(-(intptr_t) (heap_end - cursor));
+      } else {
+          last = append_free_block(last, cursor, heap_end);
+      }
+  }
+
+  // If nothing is kept at all, the list is empty now
+  if (!last) {
+      HEAD = NULL;
+  }
+  TAIL = last;
+}
+
+// Copy the live memory of all tags into stats,
+// which must have room for MAX_TAGS entries
+void mytag_snapshot(struct tag_stats* stats) {
+  for (int i = 0; i < MAX_TAGS; i++) {
+      stats[i].live_bytes = atomic_load_explicit(&TAG_BYTES[i], memory_order_relaxed);
+      stats[i].live_blocks = atomic_load_explicit(&TAG_BLOCKS[i], memory_order_relaxed);
+  }
+}
+
+
+// Convenience function to print the live memory of all tags in use
+void print_tags() {
+  struct tag_stats stats[MAX_TAGS];
+  mytag_snapshot(stats);
+
+  printf("------------------------------\n");
+  printf("%-5s %-12s %-10s\n", "Tag", "Bytes", "Blocks");
+  printf("------------------------------\n");
+  for (int i = 0; i < MAX_TAGS; i++) {
+      if (stats[i].live_blocks) {
+          printf("%-5i %-12li %-10li\n", i,
+                 (long int) stats[i].live_bytes,
+                 (long int) stats[i].live_blocks);
+      }
+  }
+  printf("------------------------------\n\n");
+}
+
 int main() {
     print_list();
     
@@ -352,6 +910,80 @@ int main() {
     z = mymalloc(20);
     print_list();
 
+    printf("Free remaining blocks.\n");
+    myfree(y);
+    myfree(z);
+    print_list();
+
+    struct handle *a, *b, *c;
+
+    printf("Allocate three handles of 400, 150 and 50 bytes.\n");
+    a = myhandle_alloc(400);
+    b = myhandle_alloc(150);
+    c = myhandle_alloc(50);
+    print_list();
+
+    printf("Free first handle, lock the third one and compact.\nSecond handle will slide down, third one stays pinned.\n");
+    myhandle_free(a);
+    myhandle_lock(c);
+    mycompact();
+    print_list();
+
+    printf("Unlock third handle, free the second one and compact.\nThird handle (split off a larger free block) will slide down, heap will shrink.\n");
+    myhandle_unlock(c);
+    myhandle_free(b);
+    char* old_break = sbrk(0);
+    mycompact();
+    printf("Program break moved by %li bytes.\n", (long int) ((char*) sbrk(0) - old_break));
+    print_list();
+
+    printf("Allocate 100 and 200 bytes with tag 1, 50 bytes with tag 2.\n");
+    x = mymalloc_tagged(100, 1);
+    y = mymalloc_tagged(200, 1);
+    z = mymalloc_tagged(50, 2);
+    print_tags();
+
+    printf("Free the 200 bytes with tag 1.\n");
+    myfree(y);
+    print_tags();
+
+    printf("Allocate 64 KiB, fill it with ones and free it again.\n");
+    x = mymalloc(65536);
+    memset(x, 0xff, 65536);
+    myfree(x);
+
+    printf("Pretend it has been free for long enough, and purge.\n");
+    set_freed_at(get_block_ptr(x), coarse_now() - PURGE_DECAY_SECONDS);
+    mypurge();
+    printf("Block is purged: %i\n\n", get_block_ptr(x)->purged);
+
+    printf("Allocate 60000 zeroed bytes.\nBest-fit allocation will recycle the purged block, and only zero its partial pages.\n");
+    y = mycalloc(1, 60000);
+    size_t i, nb_nonzero = 0;
+    for (i = 0; i < 60000; i++) {
+        if (((char*) y)[i]) { nb_nonzero++; }
+    }
+    printf("Recycled purged block: %i, non-zero bytes: %li\n\n", y == x, (long int) nb_nonzero);
+    myfree(y);
+
+    printf("Allocate 200000 bytes, which get their own mapping, and fill them.\n");
+    x = mymalloc(200000);
+    for (i = 0; i < 200000; i++) {
+        ((unsigned char*) x)[i] = (unsigned char) i;
+    }
+
+    printf("Grow the block to 2000000 bytes.\nrealloc() will remap its pages instead of copying the data.\n");
+    y = myrealloc(x, 2000000);
+    size_t nb_wrong = 0;
+    for (i = 0; i < 200000; i++) {
+        if (((unsigned char*) y)[i] != (unsigned char) i) { nb_wrong++; }
+    }
+    printf("Block was moved: %i, wrong bytes: %li\n\n", y != x, (long int) nb_wrong);
+
+    printf("Free the block twice.\n");
+    myfree(y);
+    myfree(y);
+    printf("Mapped blocks left: %i\n\n", MAPPED != NULL);
 
 
     return 0;